@@ -0,0 +1,33 @@
+// 1M concurrent sleeping coroutines on a single thread.
+// g++ -std=c++20 -O2 -DSAND_USE_CORO bench_coro.cc sand.cpp
+
+#include <cassert>
+#include <iostream>
+#include "sand.hpp"
+
+namespace {
+    int64_t awake = 0, lateness = 0;
+
+    sand::task sleeper( int64_t lapse ) {
+        int64_t deadline = sand::uptime() + lapse;
+        co_await sand::after( lapse );
+        lateness += sand::uptime() - deadline;
+        awake++;
+    }
+}
+
+int main() {
+    const int N = 1000000;
+
+    sand::timer spawn;
+    for( int i = 0; i < N; ++i ) {
+        sleeper( sand::milliseconds( 1000 + i % 1000 ) ); // spread over a 1s window
+    }
+    std::cout << N << " coroutines suspended in " << spawn.ms() << "ms, pending: " << sand::loop::local().size() << std::endl;
+
+    sand::loop::local().run();
+    assert( awake == N );
+
+    std::cout << N << " coroutines resumed, last one " << spawn.ms() << "ms after start, "
+              << "mean lateness " << double(lateness) / N << "ms" << std::endl;
+}
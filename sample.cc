@@ -1,8 +1,67 @@
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
 #include <cassert>
+#include <vector>
 #include "sand.hpp"
 
+namespace {
+    // minimal protobuf walker for perfetto traces: every length must fit in its parent message.
+    // descends into Trace.packet, TracePacket.track_event/track_descriptor; collects TrackEvent.name and
+    // counts TracePacket.clock_snapshot
+    bool walk( const std::string &pb, size_t at, size_t end, int depth, std::vector< std::string > &names, int &clocks ) {
+        auto varint = [&]( uint64_t &v ) {
+            v = 0;
+            for( int shift = 0; at < end && shift < 64; shift += 7 ) {
+                unsigned char ch = (unsigned char)pb[ at++ ];
+                v |= uint64_t( ch & 0x7f ) << shift;
+                if( !( ch & 0x80 ) ) return true;
+            }
+            return false;
+        };
+        while( at < end ) {
+            uint64_t key, len;
+            if( !varint( key ) ) return false;
+            int field = int( key >> 3 ), type = int( key & 7 );
+            /**/ if( type == 0 ) { if( !varint( len ) ) return false; }
+            else if( type == 1 ) at += 8;
+            else if( type == 5 ) at += 4;
+            else if( type == 2 ) {
+                if( !varint( len ) || len > end - at ) return false;
+                bool nested = ( depth == 0 && field == 1 ) || ( depth == 1 && ( field == 11 || field == 60 ) );
+                if( nested && !walk( pb, at, at + len, depth + 1, names, clocks ) ) return false;
+                if( depth == 2 && field == 23 ) names.push_back( pb.substr( at, len ) );
+                if( depth == 1 && field == 6 ) clocks++;
+                at += len;
+            }
+            else return false;
+        }
+        return at == end;
+    }
+}
+
+#ifdef SAND_USE_CORO
+namespace {
+    int ticks = 0;
+    bool slept = false, timedout = false;
+
+    sand::task sleepy( sand::token *tk ) {
+        slept = co_await sand::after( sand::milliseconds(50), tk );
+    }
+    sand::task impatient() {
+        sand::token tk;
+        tk.cancel_after( sand::milliseconds(30) );
+        timedout = !co_await sand::after( sand::seconds(10), &tk );
+    }
+    sand::task ticker( sand::token *tk ) {
+        sand::interval iv( sand::milliseconds(20), tk );
+        while( co_await iv ) ticks++;
+    }
+}
+#endif
+
 int main() {
     using namespace sand;
 
@@ -127,6 +186,108 @@ int main() {
         assert( str(future) == "2092-01-01 00:00:01.000" );
     }
 
+    {
+        std::cout << "[ ] business calendar";
+            sand::business_calendar cal;
+            auto friday = datetime(2015,9,25,16,0,0);
+            assert( str( cal.add(friday, 1) ) == "2015-09-28 16:00:00.000" );
+            assert( str( cal.add(friday, 5) ) == "2015-10-02 16:00:00.000" );
+            assert( cal.count( date(2015,9,21), date(2015,9,28) ) == 5 );
+            assert( cal.worked( friday, datetime(2015,9,28,10,0,0) ) == hours(2) );
+            cal.holiday( date(2015,9,28) );
+            assert( str( cal.add(friday, 1) ) == "2015-09-29 16:00:00.000" );
+            assert( str( cal.add(datetime(2015,9,29,16,0,0), -1) ) == str(friday) );
+            assert( cal.count( date(2015,9,28), date(2015,9,21) ) == -5 );
+
+            int64_t stamps[] = { friday, date(2015,9,28) }, due[2];
+            cal.add( stamps, 2, 3, due );
+            assert( str(due[0]) == "2015-10-01 16:00:00.000" && str(due[1]) == "2015-10-01 00:00:00.000" );
+
+            sand::business_calendar y2015( 2015, 2015 );
+            assert( y2015.add( datetime(2016,3,1,10,0,0), 1 ) == sand::business_calendar::invalid );
+            assert( y2015.add( date(2015,12,30), 5 ) == sand::business_calendar::invalid );
+            assert( y2015.add( date(2016,3,1), 0 ) == sand::business_calendar::invalid );
+            assert( str( y2015.add( date(2015,12,30), 1 ) ) == "2015-12-31 00:00:00.000" );
+            assert( y2015.count( date(2015,1,1), date(2016,1,1) ) == 261 );
+            assert( y2015.count( date(2014,12,1), date(2015,2,1) ) == sand::business_calendar::invalid );
+            y2015.hours( hours(-2), hours(30) ); // clamped to a whole day
+            assert( y2015.worked( date(2015,9,21), date(2015,9,23) ) == hours(48) );
+            std::cout << "\r[x]" << std::endl;
+    }
+
+    {
+        std::cout << "[ ] cached clock";
+            int64_t before = sand::utc();
+            assert( sand::cached::start() );
+            sand::sleep( 5 );
+            int64_t cached = sand::cached::utc();
+            assert( before <= cached && cached <= sand::utc() );
+            assert( sand::cached::now() <= sand::now() );
+            assert( sand::cached::staleness() >= 0 );
+            assert( sand::cached::str().size() == str( now() ).size() );
+            uint64_t beat = sand::cached::ticks();
+            for( int i = 0; i < 1000 && sand::cached::ticks() == beat; ++i ) sand::sleep( 1 );
+            assert( sand::cached::ticks() > beat );
+            sand::cached::stop();
+            assert( sand::cached::staleness() == 0 );
+            assert( sand::cached::uptime() <= sand::uptime() );
+            std::cout << "\r[x]" << std::endl;
+    }
+
+    {
+        std::cout << "[ ] tracing";
+            {
+                sand::trace::scope sc("sample");
+                sand::trace::instant("tick");
+                sand::trace::counter("items", 42);
+            }
+            assert( sand::trace::flush("sand.trace.json") );
+            std::stringstream ss;
+            ss << std::ifstream("sand.trace.json").rdbuf();
+            std::remove("sand.trace.json");
+            assert( ss.str().find("\"ph\":\"B\"") != std::string::npos );
+            assert( ss.str().find("\"ph\":\"E\"") != std::string::npos );
+            assert( ss.str().find("\"args\":{\"items\":42}") != std::string::npos );
+
+            std::string longer( 300, 'x' );
+            {
+                sand::trace::scope sc("sample");
+                sand::trace::instant( longer.c_str() );
+                sand::trace::counter( longer.c_str(), 7 );
+            }
+            assert( sand::trace::flush("sand.trace.pftrace") );
+            std::stringstream pb;
+            pb << std::ifstream("sand.trace.pftrace", std::ios::binary).rdbuf();
+            std::remove("sand.trace.pftrace");
+            std::vector< std::string > names;
+            int clocks = 0;
+            assert( walk( pb.str(), 0, pb.str().size(), 0, names, clocks ) );
+            assert( clocks == 1 ); // realtime stamps need a snapshot to map into perfetto's boottime
+            assert( names.size() == 2 && names[0] == "sample" && names[1] == longer.substr(0, 256) );
+            std::cout << "\r[x]" << std::endl;
+    }
+
+#ifdef SAND_USE_CORO
+    {
+        std::cout << "[ ] coroutine timers";
+            sand::timer dt;
+            sand::token tk;
+            tk.cancel_after( sand::milliseconds(110) );
+            sand::token slow;
+            slow.cancel_after( sand::seconds(3) ); // must not hold run() once sleepy() is done
+            sleepy( &slow );
+            impatient();
+            ticker( &tk );
+            sand::loop::local().run();
+            assert( slept );
+            assert( timedout );
+            assert( sand::loop::local().ok() );
+            assert( ticks >= 4 && ticks <= 5 ); // 20ms ticks within a 110ms timeout
+            assert( dt.ms() < 1000 );
+            std::cout << "\r[x]" << std::endl;
+    }
+#endif
+
     sand::chrono total(4);
     sand::looper looper(0.5);
     while( total.t() < 1 ) {
@@ -134,6 +295,9 @@ int main() {
         sand::sleep(sand::seconds(1)/4);
     }
 
+    // left running on purpose: the ticker must be joined on exit without a stop() call
+    sand::cached::start();
+
     std::cout << "---" << std::endl;
     std::cout << "All ok, " << timer.ms() << "ms " << std::endl;
 }
@@ -5,10 +5,12 @@
 #include <cmath>
 #include <ctime>
 
+#include <algorithm>
 #include <chrono>
 #include <deque>
 #include <iomanip>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -23,6 +25,37 @@
 #   include <omp.h>
 #endif
 
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#ifdef _WIN32
+#   include <io.h>
+#   include <process.h>
+#   define SAND_OPEN(path)       ::_open( path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644 )
+#   define SAND_WRITE(fd,ptr,n)  ::_write( fd, ptr, (unsigned)(n) )
+#   define SAND_CLOSE(fd)        ::_close( fd )
+#   define SAND_GETPID()         ::_getpid()
+#else
+#   include <unistd.h>
+#   define SAND_OPEN(path)       ::open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 )
+#   define SAND_WRITE(fd,ptr,n)  ::write( fd, ptr, n )
+#   define SAND_CLOSE(fd)        ::close( fd )
+#   define SAND_GETPID()         ::getpid()
+#endif
+#ifdef __linux__
+#   include <sys/syscall.h>
+#endif
+#ifdef _MSC_VER
+#   include <intrin.h>
+#endif
+
+#ifdef SAND_USE_CORO
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 #pragma warning(push)
 #pragma warning(disable: 4996) // gmtime, localtime
 
@@ -426,5 +459,865 @@ namespace
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+namespace sand
+{
+namespace
+{
+    const int64_t DAY = 86400000;
+
+    int64_t daynum( int64_t stamp ) {
+        return stamp >= 0 ? stamp / DAY : -( ( -stamp + DAY - 1 ) / DAY );
+    }
+
+    int weekday( int64_t day ) {
+        return int( ( ( day + 4 ) % 7 + 7 ) % 7 ); // 1970/01/01 was a thursday (0 = sunday)
+    }
+
+    int popcount( uint64_t x ) {
+#   if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll( x );
+#   else
+        // swar fallback. msvc __popcnt64 needs a POPCNT capable cpu and does not exist on 32-bit targets
+        x = x - ( ( x >> 1 ) & 0x5555555555555555ull );
+        x = ( x & 0x3333333333333333ull ) + ( ( x >> 2 ) & 0x3333333333333333ull );
+        x = ( x + ( x >> 4 ) ) & 0x0f0f0f0f0f0f0f0full;
+        return int( ( x * 0x0101010101010101ull ) >> 56 );
+#   endif
+    }
+
+    int lowest( uint64_t x ) { // x != 0
+#   if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll( x );
+#   elif defined(_MSC_VER) && ( defined(_M_X64) || defined(_M_ARM64) )
+        unsigned long index;
+        _BitScanForward64( &index, x );
+        return (int)index;
+#   else
+        return popcount( ( x & ( 0 - x ) ) - 1 );
+#   endif
+    }
+}
+
+    business_calendar::business_calendar( int first_year, int last_year ) :
+        first( daynum( date( first_year, 1, 1 ) ) ),
+        last( daynum( date( last_year + 1, 1, 1 ) ) ),
+        open( sand::hours(9) ), close( sand::hours(17) ), weekend( SAT | SUN ) {
+        if( last < first ) last = first;
+        rebuild();
+    }
+
+    void business_calendar::rebuild() {
+        bits.assign( size_t( ( last - first ) / 64 + 1 ), 0 ); // +1: rank(last) reads one past the end
+        for( int64_t day = first; day < last; ++day ) {
+            if( !( weekend & ( 1 << weekday( day ) ) ) ) bits[ size_t( ( day - first ) >> 6 ) ] |= 1ull << ( ( day - first ) & 63 );
+        }
+        for( int64_t day : off ) {
+            bits[ size_t( ( day - first ) >> 6 ) ] &= ~( 1ull << ( ( day - first ) & 63 ) );
+        }
+        ranks.assign( bits.size() + 1, 0 );
+        rerank( 0 );
+    }
+
+    void business_calendar::rerank( size_t word ) {
+        for( size_t w = word; w < bits.size(); ++w ) ranks[ w + 1 ] = ranks[ w ] + popcount( bits[ w ] );
+    }
+
+    void business_calendar::weekends( int weekday_mask ) {
+        weekend = weekday_mask;
+        rebuild();
+    }
+
+    void business_calendar::hours( int64_t from, int64_t to ) {
+        // working hours lie within a single day; out-of-range values are clamped to [0,DAY]
+        open = from < 0 ? 0 : from > DAY ? DAY : from;
+        close = to < open ? open : to > DAY ? DAY : to;
+    }
+
+    void business_calendar::holiday( int64_t stamp ) {
+        int64_t day = daynum( stamp );
+        if( day < first || day >= last ) return;
+        off.push_back( day );
+        size_t word = size_t( ( day - first ) >> 6 );
+        bits[ word ] &= ~( 1ull << ( ( day - first ) & 63 ) );
+        rerank( word );
+    }
+
+    void business_calendar::holidays( const std::vector< int64_t > &stamps ) {
+        for( int64_t stamp : stamps ) {
+            int64_t day = daynum( stamp );
+            if( day >= first && day < last ) off.push_back( day );
+        }
+        rebuild();
+    }
+
+    int64_t business_calendar::rank( int64_t day ) const {
+        int64_t i = day - first; // callers check first <= day <= last
+        uint64_t below = ( 1ull << ( i & 63 ) ) - 1;
+        return ranks[ size_t( i >> 6 ) ] + popcount( bits[ size_t( i >> 6 ) ] & below );
+    }
+
+    int64_t business_calendar::select( int64_t nth ) const {
+        if( nth < 0 || nth >= ranks.back() ) return invalid;
+        size_t word = size_t( std::upper_bound( ranks.begin(), ranks.end(), nth ) - ranks.begin() ) - 1;
+        uint64_t w = bits[ word ];
+        for( int64_t skip = nth - ranks[ word ]; skip > 0; --skip ) w &= w - 1;
+        return first + int64_t( word ) * 64 + lowest( w );
+    }
+
+    int64_t business_calendar::elapsed( int64_t stamp ) const {
+        // working milliseconds from the first covered day up to stamp
+        int64_t day = daynum( stamp ), tod = stamp - day * DAY;
+        int64_t partial = 0;
+        if( working( stamp ) ) partial = ( tod < open ? open : tod > close ? close : tod ) - open;
+        return rank( day ) * ( close - open ) + partial;
+    }
+
+    bool business_calendar::working( int64_t stamp ) const {
+        int64_t day = daynum( stamp );
+        if( day < first || day >= last ) return false;
+        return ( bits[ size_t( ( day - first ) >> 6 ) ] >> ( ( day - first ) & 63 ) ) & 1;
+    }
+
+    int64_t business_calendar::add( int64_t stamp, int64_t days ) const {
+        int64_t day = daynum( stamp ), tod = stamp - day * DAY;
+        if( day < first || day >= last ) return invalid;
+        if( !days ) return stamp;
+        int64_t nth = days > 0 ? rank( day + 1 ) + days - 1 : rank( day ) + days;
+        int64_t found = select( nth );
+        return found == invalid ? invalid : found * DAY + tod;
+    }
+
+    int64_t business_calendar::count( int64_t from, int64_t to ) const {
+        // [from,to) only looks at days before daynum(to), so the first uncovered day is a valid bound
+        int64_t a = daynum( from ), b = daynum( to );
+        if( a < first || a > last || b < first || b > last ) return invalid;
+        return rank( b ) - rank( a );
+    }
+
+    int64_t business_calendar::worked( int64_t from, int64_t to ) const {
+        if( from < first * DAY || from > last * DAY || to < first * DAY || to > last * DAY ) return invalid;
+        return elapsed( to ) - elapsed( from );
+    }
+
+    void business_calendar::add( const int64_t *stamps, size_t n, int64_t days, int64_t *out ) const {
+        for( size_t i = 0; i < n; ++i ) out[i] = add( stamps[i], days );
+    }
+
+    void business_calendar::count( const int64_t *from, const int64_t *to, size_t n, int64_t *out ) const {
+        for( size_t i = 0; i < n; ++i ) out[i] = count( from[i], to[i] );
+    }
+
+    void business_calendar::worked( const int64_t *from, const int64_t *to, size_t n, int64_t *out ) const {
+        for( size_t i = 0; i < n; ++i ) out[i] = worked( from[i], to[i] );
+    }
+
+namespace cached
+{
+namespace
+{
+    // seqlock: odd sequence while the ticker is writing. everything fits in one cache line.
+    struct alignas(64) slot_t {
+        std::atomic< uint64_t > seq; // also the heartbeat: 2 per publish, never wraps in practice
+        std::atomic< int64_t > utc, now, uptime;
+        std::atomic< uint64_t > text[3]; // "yyyy-mm-dd HH:MM:SS.MS\0"
+    } slot;
+
+    std::atomic< bool > running( false );
+    std::mutex control;
+
+    // joined on exit too, so programs may return from main() without calling stop()
+    struct ticker_t {
+        std::thread thread;
+        ~ticker_t() {
+            running = false;
+            if( thread.joinable() ) thread.join();
+        }
+    } ticker;
+
+    void publish( int64_t u, int64_t n, int64_t up ) {
+        uint64_t words[3] = {};
+        std::string s = sand::str( n );
+        memcpy( words, s.c_str(), s.size() < sizeof(words) ? s.size() : sizeof(words) - 1 );
+
+        uint64_t seq = slot.seq.load( std::memory_order_relaxed );
+        slot.seq.store( seq + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        slot.utc.store( u, std::memory_order_relaxed );
+        slot.now.store( n, std::memory_order_relaxed );
+        slot.uptime.store( up, std::memory_order_relaxed );
+        for( int i = 0; i < 3; ++i ) slot.text[i].store( words[i], std::memory_order_relaxed );
+        slot.seq.store( seq + 2, std::memory_order_release );
+    }
+
+    void loop( int64_t resolution ) {
+        auto next = std::chrono::steady_clock::now();
+        while( running ) {
+            publish( sand::utc(), sand::now(), sand::uptime() );
+
+            next += std::chrono::milliseconds( resolution );
+            auto clock = std::chrono::steady_clock::now();
+            if( next < clock ) next = clock; // fell behind: do not burst to catch up
+            std::this_thread::sleep_until( next );
+        }
+    }
+}
+
+    bool start( int64_t resolution ) {
+        std::lock_guard< std::mutex > lock( control );
+        if( running ) return false;
+        if( resolution < 1 ) resolution = 1;
+        publish( sand::utc(), sand::now(), sand::uptime() );
+        running = true;
+        ticker.thread = std::thread( loop, resolution );
+        return true;
+    }
+
+    void stop() {
+        std::lock_guard< std::mutex > lock( control );
+        if( !running ) return;
+        running = false;
+        ticker.thread.join();
+        publish( 0, 0, 0 );
+    }
+
+    int64_t utc() {
+        int64_t t = slot.utc.load( std::memory_order_relaxed );
+        return t ? t : sand::utc();
+    }
+
+    int64_t now() {
+        int64_t t = slot.now.load( std::memory_order_relaxed );
+        return t ? t : sand::now();
+    }
+
+    int64_t uptime() {
+        // uptime may legitimately be zero, so check utc instead
+        return slot.utc.load( std::memory_order_relaxed ) ? slot.uptime.load( std::memory_order_relaxed ) : sand::uptime();
+    }
+
+    std::string str() {
+        uint64_t words[3];
+        uint64_t seq;
+        do {
+            while( ( seq = slot.seq.load( std::memory_order_acquire ) ) & 1 ) {}
+            for( int i = 0; i < 3; ++i ) words[i] = slot.text[i].load( std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_acquire );
+        } while( seq != slot.seq.load( std::memory_order_relaxed ) );
+
+        const char *text = (const char *)words;
+        return *text ? std::string( text ) : sand::str( sand::now() );
+    }
+
+    uint64_t ticks() {
+        return slot.seq.load( std::memory_order_relaxed ) / 2;
+    }
+
+    int64_t staleness() {
+        // heartbeat check: the published uptime against a fresh clock read
+        if( !slot.utc.load( std::memory_order_relaxed ) ) return 0;
+        int64_t age = sand::uptime() - slot.uptime.load( std::memory_order_relaxed );
+        return age > 0 ? age : 0;
+    }
+}
+
+namespace trace
+{
+namespace
+{
+    enum { BEGIN, END, INSTANT, COUNTER };
+
+    struct record {
+        int64_t tick;
+        const char *name;
+        int64_t value;
+        int type;
+        int32_t tid;
+    };
+
+    // ring slot. seq is 2*index+1 while being written and 2*index+2 once done (seqlock), so a reader
+    // racing with the writer can tell torn or overwritten slots apart and drop them.
+    struct event {
+        std::atomic< uint64_t > seq;
+        std::atomic< int64_t > tick;
+        std::atomic< const char * > name;
+        std::atomic< int64_t > value;
+        std::atomic< int > type;
+        std::atomic< int32_t > tid;           // fits in the padding: 40 bytes per event
+    };
+
+    // single writer (its owner thread), single reader (flush). rings outlive their threads: once the owner
+    // exits, the ring is retired and handed to the next thread that starts tracing. events carry their own
+    // tid, so pending events of the previous owner are neither lost nor misattributed.
+    struct ring {
+        std::atomic< uint64_t > head;
+        uint64_t tail;
+        uint64_t mask;
+        event *events;
+        int32_t tid;                          // owner; only touched by the owner thread
+        std::atomic< bool > retired;
+        ring *next;
+    };
+
+    std::atomic< ring * > rings( nullptr );
+    std::atomic< size_t > slots( 1 << 16 );
+    std::atomic< int > threads_count( 0 );
+    std::atomic_flag busy = ATOMIC_FLAG_INIT;
+    thread_local ring *local = 0;
+    thread_local bool exiting = false;
+    char signal_path[ 512 ];
+
+    // retires the ring when its thread exits
+    struct owner {
+        ring *r = 0;
+        ~owner() {
+            exiting = true;
+            local = 0;
+            if( r ) r->retired.store( true, std::memory_order_release );
+        }
+    };
+
+    const auto epoch = std::chrono::steady_clock::now();
+
+    int64_t tick() {
+        return (int64_t)std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - epoch ).count();
+    }
+
+    ring *acquire() {
+        if( exiting ) return 0; // tracing from a thread_local destructor, after our own ring was retired
+
+        size_t cap = 1;
+        while( cap < slots.load() ) cap <<= 1;
+
+        // recycle the ring of an exited thread first
+        ring *r = rings.load( std::memory_order_acquire );
+        for( ; r; r = r->next ) {
+            bool retired = true;
+            if( r->mask + 1 == cap && r->retired.compare_exchange_strong( retired, false, std::memory_order_acquire ) ) break;
+        }
+        if( !r ) {
+            r = new ring;
+            r->head = 0;
+            r->tail = 0;
+            r->mask = cap - 1;
+            r->events = new event[ cap ](); // zeroed seq: no slot looks complete yet
+            r->retired = false;
+            r->next = rings.load();
+            while( !rings.compare_exchange_weak( r->next, r ) ) {}
+        }
+#   ifdef __linux__
+        r->tid = (int32_t)::syscall( SYS_gettid );
+#   else
+        r->tid = ++threads_count;
+#   endif
+
+        static thread_local owner self;
+        self.r = r;
+        return local = r;
+    }
+
+    void push( int type, const char *name, int64_t value ) {
+        ring *r = local ? local : acquire();
+        if( !r ) return;
+        uint64_t h = r->head.load( std::memory_order_relaxed );
+        event &e = r->events[ h & r->mask ];
+        e.seq.store( 2 * h + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        e.tick.store( tick(), std::memory_order_relaxed );
+        e.name.store( name, std::memory_order_relaxed );
+        e.value.store( value, std::memory_order_relaxed );
+        e.type.store( type, std::memory_order_relaxed );
+        e.tid.store( r->tid, std::memory_order_relaxed );
+        e.seq.store( 2 * h + 2, std::memory_order_release );
+        r->head.store( h + 1, std::memory_order_release );
+    }
+
+    // copy slot i out of the ring. false if it is being (or has been) overwritten.
+    bool read( const ring *r, uint64_t i, record &out ) {
+        const event &e = r->events[ i & r->mask ];
+        uint64_t seq = e.seq.load( std::memory_order_acquire );
+        out.tick = e.tick.load( std::memory_order_relaxed );
+        out.name = e.name.load( std::memory_order_relaxed );
+        out.value = e.value.load( std::memory_order_relaxed );
+        out.type = e.type.load( std::memory_order_relaxed );
+        out.tid = e.tid.load( std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_acquire );
+        return seq == 2 * i + 2 && e.seq.load( std::memory_order_relaxed ) == seq;
+    }
+
+    // buffered file writer. no allocations, no stdio: safe to use from a signal handler.
+    struct sink {
+        int fd;
+        size_t len = 0;
+        char buf[ 4096 ];
+
+        explicit sink( const char *path ) : fd( SAND_OPEN( path ) )
+        {}
+        ~sink() {
+            drain();
+            if( fd >= 0 ) SAND_CLOSE( fd );
+        }
+        void drain() {
+            for( size_t done = 0; fd >= 0 && done < len; ) {
+                auto n = SAND_WRITE( fd, buf + done, len - done );
+                if( n > 0 ) done += (size_t)n;
+                else SAND_CLOSE( fd ), fd = -1;
+            }
+            len = 0;
+        }
+        void put( const char *p, size_t n ) {
+            while( n ) {
+                if( len == sizeof(buf) ) drain();
+                size_t chunk = sizeof(buf) - len < n ? sizeof(buf) - len : n;
+                memcpy( buf + len, p, chunk );
+                len += chunk, p += chunk, n -= chunk;
+            }
+        }
+        void put( const char *p ) {
+            put( p, strlen( p ) );
+        }
+        void num( int64_t x, int zerodigits = 0 ) {
+            char tmp[ 24 ], *p = tmp + sizeof(tmp);
+            uint64_t u = x < 0 ? 0 - (uint64_t)x : (uint64_t)x;
+            do *--p = char( '0' + u % 10 ), u /= 10, --zerodigits; while( u || zerodigits > 0 );
+            if( x < 0 ) *--p = '-';
+            put( p, tmp + sizeof(tmp) - p );
+        }
+        void quoted( const char *s ) {
+            put( "\"" );
+            for( ; *s; ++s ) {
+                unsigned char ch = (unsigned char)*s;
+                if( ch == '"' || ch == '\\' ) put( "\\", 1 );
+                if( ch >= 0x20 ) put( s, 1 );
+            }
+            put( "\"" );
+        }
+    };
+
+    // protobuf message builder, enough for perfetto's TracePacket. names are cut to 256 bytes, so the
+    // largest packet (a descriptor: ~45 bytes of ids and tags plus one name) always fits in buf.
+    const size_t name_max = 256;
+
+    struct proto {
+        size_t len = 0;
+        char buf[ 512 ];
+
+        void varint( uint64_t v ) {
+            while( v >= 0x80 && len < sizeof(buf) ) buf[ len++ ] = char( v | 0x80 ), v >>= 7;
+            if( len < sizeof(buf) ) buf[ len++ ] = char( v );
+        }
+        void field( int id, uint64_t v ) {
+            varint( uint64_t( id ) << 3 | 0 );
+            varint( v );
+        }
+        void text( int id, const char *s ) {
+            size_t n = strlen( s );
+            bytes( id, s, n > name_max ? name_max : n );
+        }
+        void bytes( int id, const char *p, size_t n ) {
+            varint( uint64_t( id ) << 3 | 2 );
+            varint( n );
+            if( len + n <= sizeof(buf) ) memcpy( buf + len, p, n ), len += n;
+        }
+        void bytes( int id, const proto &m ) {
+            bytes( id, m.buf, m.len );
+        }
+    };
+
+    // perfetto protos: Trace.packet=1; TracePacket.{clock_snapshot=6, timestamp=8, trusted_packet_sequence_id=10,
+    // track_event=11, timestamp_clock_id=58, track_descriptor=60}; ClockSnapshot.clocks=1; ClockSnapshot.Clock.
+    // {clock_id=1, timestamp=2}; TrackDescriptor.{uuid=1, name=2, process=3, thread=4, parent_uuid=5, counter=8};
+    // TrackEvent.{type=9, track_uuid=11, name=23, counter_value=30}
+    enum { TYPE_SLICE_BEGIN = 1, TYPE_SLICE_END = 2, TYPE_INSTANT = 3, TYPE_COUNTER = 4 };
+    enum { CLOCK_REALTIME_ID = 1, CLOCK_BOOTTIME_ID = 6 };
+
+    uint64_t hash( uint64_t h, const char *s ) {
+        for( ; *s; ++s ) h = ( h ^ (unsigned char)*s ) * 1099511628211ull;
+        return h;
+    }
+
+    void packet( sink &out, const proto &p ) {
+        proto head;
+        head.varint( 1 << 3 | 2 );
+        head.varint( p.len );
+        out.put( head.buf, head.len );
+        out.put( p.buf, p.len );
+    }
+
+    // events are stamped in (shifted) realtime, but perfetto's trace clock is boottime: this snapshot lets
+    // the importer convert between both. without it, every event is dropped as a clock sync failure.
+    void snapshot( sink &out, int64_t realtime ) {
+#   ifdef __linux__
+        struct timespec ts;
+        clock_gettime( CLOCK_BOOTTIME, &ts );
+        int64_t boottime = int64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+#   else
+        int64_t boottime = (int64_t)std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+#   endif
+        proto real, boot, clocks, p;
+        real.field( 1, CLOCK_REALTIME_ID );
+        real.field( 2, (uint64_t)realtime );
+        boot.field( 1, CLOCK_BOOTTIME_ID );
+        boot.field( 2, (uint64_t)boottime );
+        clocks.bytes( 1, real );
+        clocks.bytes( 1, boot );
+        p.bytes( 6, clocks );
+        p.field( 10, 1 );
+        packet( out, p );
+    }
+
+    void descriptor( sink &out, uint64_t uuid, uint64_t parent, const char *name, int64_t pid, int64_t tid, bool counter ) {
+        proto d, sub, p;
+        d.field( 1, uuid );
+        if( parent ) d.field( 5, parent );
+        if( name ) d.text( 2, name );
+        if( tid ) {
+            sub.field( 1, (uint64_t)pid );
+            sub.field( 2, (uint64_t)tid );
+            d.bytes( 4, sub );
+        } else if( !counter ) {
+            sub.field( 1, (uint64_t)pid );
+            d.bytes( 3, sub );
+        } else {
+            d.bytes( 8, sub );
+        }
+        p.bytes( 60, d );
+        packet( out, p );
+    }
+
+    bool write( const char *path ) {
+        if( busy.test_and_set() ) return false;
+
+        sink out( path );
+        bool json = strlen( path ) >= 5 && !strcmp( path + strlen( path ) - 5, ".json" );
+        int64_t pid = SAND_GETPID();
+        uint64_t process = hash( 14695981039346656037ull, "sand" ) ^ (uint64_t)pid;
+
+        // wall-clock anchor: tick -> realtime nanoseconds (plus sand::shift(), as utc() does). not utc() itself:
+        // its whole-second std::time() base would misalign processes by up to a second.
+        int64_t realtime = (int64_t)std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::system_clock::now().time_since_epoch() ).count();
+        realtime += sand::offset * 1000000;
+        int64_t anchor = realtime - tick();
+
+        if( json ) out.put( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+        else snapshot( out, realtime ), descriptor( out, process, 0, 0, pid, 0, false );
+
+        bool first = true;
+        for( ring *r = rings.load(); r; r = r->next ) {
+            uint64_t head = r->head.load( std::memory_order_acquire );
+            uint64_t from = head - r->tail > r->mask + 1 ? head - ( r->mask + 1 ) : r->tail;
+            int32_t described = 0; // rings change owners, so thread tracks are described as tids show up
+
+            for( uint64_t i = from; i < head; ++i ) {
+                record e;
+                if( !read( r, i, e ) ) continue;
+                int64_t ts = anchor + e.tick;
+                uint64_t thread = process ^ ( (uint64_t)e.tid << 1 | 1 );
+                if( !json && e.tid != described ) descriptor( out, thread, process, 0, pid, e.tid, false );
+                described = e.tid;
+
+                if( json ) {
+                    static const char *ph[] = { "B", "E", "i", "C" };
+                    out.put( first ? "{" : ",\n{" );
+                    first = false;
+                    out.put( "\"ph\":\"" ); out.put( ph[ e.type ] );
+                    out.put( "\",\"pid\":" ); out.num( pid );
+                    out.put( ",\"tid\":" ); out.num( e.tid );
+                    out.put( ",\"ts\":" ); out.num( ts / 1000 ); out.put( "." ); out.num( ts % 1000, 3 );
+                    if( e.type != END ) { out.put( ",\"name\":" ); out.quoted( e.name ); }
+                    if( e.type == INSTANT ) out.put( ",\"s\":\"t\"" );
+                    if( e.type == COUNTER ) { out.put( ",\"args\":{" ); out.quoted( e.name ); out.put( ":" ); out.num( e.value ); out.put( "}" ); }
+                    out.put( "}" );
+                } else {
+                    static const int types[] = { TYPE_SLICE_BEGIN, TYPE_SLICE_END, TYPE_INSTANT, TYPE_COUNTER };
+                    uint64_t track = thread;
+                    if( e.type == COUNTER ) {
+                        // counters live in their own process-scoped track. repeated descriptors are fine.
+                        track = hash( process, e.name );
+                        descriptor( out, track, process, e.name, pid, 0, true );
+                    }
+                    proto te, p;
+                    te.field( 9, types[ e.type ] );
+                    te.field( 11, track );
+                    if( e.type != END && e.type != COUNTER ) te.text( 23, e.name );
+                    if( e.type == COUNTER ) te.field( 30, (uint64_t)e.value );
+                    p.field( 8, (uint64_t)ts );
+                    p.field( 58, CLOCK_REALTIME_ID );
+                    p.field( 10, 1 );
+                    p.bytes( 11, te );
+                    packet( out, p );
+                }
+            }
+            r->tail = head;
+        }
+
+        if( json ) out.put( "\n]}\n" );
+        out.drain();
+
+        bool ok = out.fd >= 0;
+        busy.clear();
+        return ok;
+    }
+
+    void on_signal( int ) {
+        write( signal_path );
+    }
+}
+
+    void begin( const char *name ) {
+        push( BEGIN, name, 0 );
+    }
+    void end() {
+        push( END, "", 0 );
+    }
+    void instant( const char *name ) {
+        push( INSTANT, name, 0 );
+    }
+    void counter( const char *name, int64_t value ) {
+        push( COUNTER, name, value );
+    }
+
+    void capacity( size_t events ) {
+        slots = events ? events : 1;
+    }
+
+    bool flush( const std::string &file ) {
+        return write( file.c_str() );
+    }
+
+    bool flush_on( int signo, const std::string &file ) {
+        if( file.size() >= sizeof(signal_path) ) return false;
+        memcpy( signal_path, file.c_str(), file.size() + 1 );
+        return std::signal( signo, on_signal ) != SIG_ERR;
+    }
+}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef SAND_USE_CORO
+
+namespace sand
+{
+using detail::waiter;
+
+namespace
+{
+    // circular doubly linked lists of waiters
+    void push_back( waiter *&head, waiter *w ) {
+        if( !head ) {
+            head = w->prev = w->next = w;
+        } else {
+            w->prev = head->prev;
+            w->next = head;
+            head->prev->next = w;
+            head->prev = w;
+        }
+    }
+    void unlink( waiter *&head, waiter *w ) {
+        if( w->next == w ) {
+            head = 0;
+        } else {
+            w->prev->next = w->next;
+            w->next->prev = w->prev;
+            if( head == w ) head = w->next;
+        }
+        w->prev = w->next = 0;
+    }
+}
+
+    // waiters
+
+    detail::waiter::~waiter() {
+        if( state != idle ) host->erase( this );
+        if( linked ) owner->detach( this );
+    }
+
+    bool detail::waiter::ready() {
+        cancelled = owner && owner->cancelled();
+        return cancelled || deadline <= sand::uptime();
+    }
+
+    void detail::waiter::suspend( std::coroutine_handle<> h ) {
+        handle = h;
+        host = &loop::local();
+        host->insert( this );
+        if( owner ) owner->attach( this );
+    }
+
+    sleeper after( int64_t lapse, token *tk ) {
+        return sleeper( sand::uptime() + lapse, tk );
+    }
+
+    sleeper at( int64_t stamp, token *tk ) {
+        return sleeper( sand::uptime() + ( stamp - sand::utc() ), tk );
+    }
+
+    interval::interval( int64_t lapse, token *tk ) : period( lapse > 0 ? lapse : 1 ) {
+        w.deadline = sand::uptime() + period;
+        w.owner = tk;
+    }
+
+    bool interval::await_resume() {
+        if( w.cancelled ) return false;
+        // keep phase. if we are late, skip the missed ticks instead of firing them back to back
+        int64_t now = sand::uptime();
+        w.deadline += period;
+        if( w.deadline <= now ) w.deadline += ( ( now - w.deadline ) / period + 1 ) * period;
+        return true;
+    }
+
+    // tokens
+
+    token::~token() {
+        while( head ) {
+            waiter *w = head;
+            detach( w );
+            w->owner = 0;
+        }
+    }
+
+    void token::attach( waiter *w ) {
+        w->tprev = 0;
+        w->tnext = head;
+        if( head ) head->tprev = w;
+        head = w;
+        w->linked = true;
+    }
+
+    void token::detach( waiter *w ) {
+        if( w->tprev ) w->tprev->tnext = w->tnext; else head = w->tnext;
+        if( w->tnext ) w->tnext->tprev = w->tprev;
+        w->tprev = w->tnext = 0;
+        w->linked = false;
+    }
+
+    void token::cancel() {
+        flag = true;
+        // do not resume from here: requeue as already due, so the loop resumes them on its next step
+        while( head ) {
+            waiter *w = head;
+            detach( w );
+            w->cancelled = true;
+            w->host->erase( w );
+            w->deadline = INT64_MIN;
+            w->host->insert( w );
+        }
+        if( alarm.host ) alarm.host->erase( &alarm );
+    }
+
+    void token::cancel_after( int64_t lapse ) {
+        if( alarm.host ) alarm.host->erase( &alarm );
+        alarm.host = &loop::local();
+        alarm.owner = this;
+        alarm.deadline = sand::uptime() + lapse;
+        alarm.host->insert( &alarm );
+    }
+
+    void token::cancel_at( int64_t stamp ) {
+        cancel_after( stamp - sand::utc() );
+    }
+
+    // loop
+
+    loop::loop() : armed( INT64_MAX ) {
+        epfd = epoll_create1( EPOLL_CLOEXEC );
+        tfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = tfd;
+        if( !ok() || epoll_ctl( epfd, EPOLL_CTL_ADD, tfd, &ev ) < 0 ) {
+            if( tfd >= 0 ) close( tfd );
+            if( epfd >= 0 ) close( epfd );
+            epfd = tfd = -1;
+        }
+    }
+
+    loop::~loop() {
+        if( tfd >= 0 ) close( tfd );
+        if( epfd >= 0 ) close( epfd );
+    }
+
+    loop &loop::local() {
+        static thread_local loop self;
+        return self;
+    }
+
+    void loop::insert( waiter *w ) {
+        push_back( buckets[ w->deadline ], w );
+        w->state = waiter::queued;
+        if( w->handle ) ++count; // token alarms do not keep the loop alive
+    }
+
+    void loop::erase( waiter *w ) {
+        if( w->state == waiter::queued ) {
+            auto it = buckets.find( w->deadline );
+            unlink( it->second, w );
+            if( !it->second ) buckets.erase( it );
+        }
+        else if( w->state == waiter::due ) {
+            // not resumed yet (ie, destroyed by a sibling of the same batch)
+            unlink( batch, w );
+        }
+        else return;
+        w->state = waiter::idle;
+        if( w->handle ) --count;
+    }
+
+    bool loop::step() {
+        if( !count || !ok() ) return false;
+
+        int64_t now = sand::uptime();
+        int64_t next = buckets.begin()->first;
+        if( next > now ) {
+            // relative arming, so the kernel timer honors sand::shift() like every other clock here
+            if( next != armed ) {
+                int64_t lapse = next - now;
+                struct itimerspec its = {};
+                its.it_value.tv_sec = lapse / 1000;
+                its.it_value.tv_nsec = ( lapse % 1000 ) * 1000000;
+                timerfd_settime( tfd, 0, &its, 0 );
+                armed = next;
+            }
+
+            struct epoll_event ev;
+            while( epoll_wait( epfd, &ev, 1, -1 ) < 0 ) {
+                if( errno != EINTR ) return false;
+            }
+
+            uint64_t expirations;
+            if( read( tfd, &expirations, sizeof(expirations) ) > 0 ) armed = INT64_MAX;
+            now = sand::uptime();
+        }
+
+        // collect first, resume later: waiters re-armed while resuming go to the next batch
+        while( !buckets.empty() && buckets.begin()->first <= now ) {
+            waiter *&bucket = buckets.begin()->second;
+            while( bucket ) {
+                waiter *w = bucket;
+                unlink( bucket, w );
+                if( w->linked ) w->owner->detach( w );
+                w->state = waiter::due;
+                push_back( batch, w );
+            }
+            buckets.erase( buckets.begin() );
+        }
+        while( batch ) {
+            waiter *w = batch;
+            unlink( batch, w );
+            w->state = waiter::idle;
+            if( w->handle ) --count;
+            if( w->handle ) w->handle.resume();
+            else w->owner->cancel();
+        }
+
+        return count > 0;
+    }
+}
+
+#endif
+
 #pragma warning(pop)
 
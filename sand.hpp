@@ -12,6 +12,13 @@
 #include <ctime>
 #include <deque>
 #include <string>
+#include <vector>
+
+#ifdef SAND_USE_CORO
+#include <coroutine>
+#include <exception>
+#include <map>
+#endif
 
 #define SAND_VERSION "v2.0.0" /* (2015/09/26) Upgraded version - more portable, less error prone
 #define SAND_VERSION "v1.0.0" // (2013/04/12) Initial version */
@@ -166,9 +173,297 @@ namespace sand
         }
     };
 
+    // usage:
+    // sand::business_calendar cal;                  // mon-fri, 09:00-17:00, years 1970-2099
+    // cal.holiday( sand::date(2015,12,25) );
+    // int64_t due = cal.add( sand::now(), 10 );     // 10 business days later, same time of day
+    // int64_t n = cal.count( a, b );                // business days in [a,b)
+    // int64_t ms = cal.worked( a, b );              // business time between a and b (in milliseconds)
+    // working days are kept in a precomputed bitmap plus running counts, so queries are popcounts and
+    // lookups instead of day by day loops. queries that start, end or land outside the covered years
+    // return business_calendar::invalid (and working() returns false); pick the year range accordingly.
+    class business_calendar
+    {
+        int64_t first, last;                 // covered day numbers, [first,last)
+        int64_t open, close;                 // working hours, as time of day
+        int weekend;
+        std::vector< uint64_t > bits;        // one bit per day, set if working
+        std::vector< int64_t > ranks;        // working days before each bitmap word
+        std::vector< int64_t > off;          // holidays, as day numbers
+
+        void rebuild();
+        void rerank( size_t word );
+        int64_t rank( int64_t day ) const;   // working days in [first,day)
+        int64_t select( int64_t nth ) const; // day number of the nth working day (0-based), or invalid
+        int64_t elapsed( int64_t stamp ) const;
+
+        public:
+
+        enum { SUN = 1, MON = 2, TUE = 4, WED = 8, THU = 16, FRI = 32, SAT = 64 };
+        static constexpr int64_t invalid = INT64_MIN;
+
+        explicit
+        business_calendar( int first_year = 1970, int last_year = 2099 );
+
+        // configuration
+        void weekends( int weekday_mask );   // ie, SAT|SUN
+        void hours( int64_t open, int64_t close ); // time of day, clamped to [0,24h] (no overnight shifts)
+        void holiday( int64_t stamp );
+        void holidays( const std::vector< int64_t > &stamps );
+
+        // queries
+        bool working( int64_t stamp ) const;
+        int64_t add( int64_t stamp, int64_t days ) const;       // nth working day after (or before, if negative)
+        int64_t count( int64_t from, int64_t to ) const;        // working days in [from,to); negative if to < from
+        int64_t worked( int64_t from, int64_t to ) const;       // working milliseconds in [from,to)
+
+        // batch queries over arrays of stamps
+        void add( const int64_t *stamps, size_t n, int64_t days, int64_t *out ) const;
+        void count( const int64_t *from, const int64_t *to, size_t n, int64_t *out ) const;
+        void worked( const int64_t *from, const int64_t *to, size_t n, int64_t *out ) const;
+    };
+
+    // cached clock (opt-in). a ticker thread publishes utc/now/uptime and a preformatted str() every
+    // `resolution` milliseconds, so reads cost a single cache line load. readers fall back to the regular
+    // clocks while the ticker is not running. values are normally less than `resolution` old, but nothing
+    // bounds a descheduled ticker: ticks() tells whether it moved since a previous read (same cache line,
+    // no clock read), while staleness() gives the exact age at the cost of an uncached clock read.
+    // usage:
+    // sand::cached::start();
+    // int64_t t = sand::cached::now();
+    // if( sand::cached::ticks() == last ) t = sand::now(); // ticker stalled since the last check
+    namespace cached
+    {
+        bool start( int64_t resolution = 1 );
+        void stop();
+
+        int64_t utc();
+        int64_t now();
+        int64_t uptime();
+        std::string str(); // sand::str( sand::cached::now() )
+
+        // number of publishes so far. cheap heartbeat: unchanged between two reads means a stalled ticker
+        uint64_t ticks();
+        // current age of the published values, in milliseconds (0 when not running). reads the real clock
+        int64_t staleness();
+    }
+
+    // tracing. events go to preallocated per-thread rings (no locks, no allocations; oldest events get
+    // overwritten) and are drained to chrome://tracing json or perfetto protobuf, with wall-clock timestamps
+    // anchored to the realtime clock (plus sand::shift()) so traces from different processes line up.
+    // names must outlive the trace; perfetto output cuts them to 256 bytes.
+    // usage:
+    // sand::trace::begin("load"); [...] sand::trace::end();
+    // { sand::trace::scope sc("parse"); [...] }
+    // sand::trace::counter("queue", q.size());
+    // sand::trace::flush("app.json"); // or "app.pftrace", or sand::trace::flush_on(SIGUSR1, "app.json");
+    namespace trace
+    {
+        void begin( const char *name );
+        void end();
+        void instant( const char *name );
+        void counter( const char *name, int64_t value );
+
+        // ring size (in events) for threads that have not traced yet. default 65536 (2.5 MiB per ring).
+        // rings of exited threads are handed over to new threads, so memory follows the peak thread count.
+        void capacity( size_t events );
+
+        // drain all rings. ".json" files get chrome trace events, anything else gets perfetto protobuf.
+        bool flush( const std::string &file );
+        // drain all rings from a signal handler (async-signal-safe writer).
+        bool flush_on( int signo, const std::string &file );
+
+        class scope
+        {
+            public:
+
+            explicit
+            scope( const char *name ) {
+                begin( name );
+            }
+            ~scope() {
+                end();
+            }
+        };
+    }
+
     // @todo
     // every(s); // if( every(5.0) ) {}
     // once();   // if( once() ) {}
+
+#ifdef SAND_USE_CORO
+
+    // coroutine timers (C++20, linux only: timerfd + epoll). opt-in: compile with -DSAND_USE_CORO
+    // usage:
+    // sand::task worker( sand::token *tk ) {
+    //     co_await sand::after( sand::milliseconds(250) );                 // delay
+    //     co_await sand::at( sand::str("2030-01-01 00:00:00") );           // deadline, absolute utc() stamp
+    //     sand::interval iv( sand::seconds(1), tk );                       // periodic, drift-free
+    //     while( co_await iv ) {}                                          // yields false once tk is cancelled
+    // }
+    // sand::token tk; tk.cancel_after( sand::seconds(10) );                // timeout
+    // worker(&tk);
+    // sand::loop::local().run();                                           // returns when no timer is pending
+
+    class loop;
+    class token;
+
+    // fire-and-forget coroutine. starts eagerly and frees itself when done.
+    struct task {
+        struct promise_type {
+            task get_return_object() { return task(); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    namespace detail
+    {
+    // a pending timer. lives inside the awaitable (so inside the coroutine frame). the loop only allocates
+    // one bucket per distinct millisecond deadline, which all the waiters due at that time share.
+    struct waiter {
+        enum { idle, queued, due };
+
+        int64_t deadline = 0;                 // uptime() milliseconds
+        int state = idle;
+        sand::loop *host = 0;
+        sand::token *owner = 0;               // optional cancellation token
+        waiter *prev = 0, *next = 0;          // siblings sharing the same deadline (or batch)
+        waiter *tprev = 0, *tnext = 0;        // siblings bound to the same token
+        bool linked = false;
+        bool cancelled = false;
+        std::coroutine_handle<> handle;       // resumed on expiry; if null, owner gets cancelled instead
+
+        waiter() = default;
+        waiter( const waiter & ) = delete;
+        waiter &operator=( const waiter & ) = delete;
+        ~waiter();
+
+        bool ready();                         // shared await_ready()
+        void suspend( std::coroutine_handle<> h );
+    };
+    }
+
+    // single-threaded event loop. waiters are bucketed per millisecond deadline, and all buckets
+    // share a single kernel timer armed for the earliest one; a due bucket is resumed as one batch.
+    // if the kernel timer cannot be created, ok() is false and step()/run() return without resuming anything.
+    class loop {
+        using waiter = detail::waiter;
+        friend struct detail::waiter;
+        friend class token;
+
+        std::map< int64_t, waiter * > buckets;
+        waiter *batch = 0;
+        size_t count = 0;
+        int64_t armed;
+        int epfd, tfd;
+
+        void insert( waiter *w );
+        void erase( waiter *w );
+
+        public:
+
+        loop();
+        ~loop();
+        loop( const loop & ) = delete;
+        loop &operator=( const loop & ) = delete;
+
+        // one loop per thread
+        static loop &local();
+
+        bool ok() const {
+            return epfd >= 0 && tfd >= 0;
+        }
+        size_t size() const {
+            return count;
+        }
+
+        // block until the next batch is due and resume it. returns false when nothing is pending (or on error).
+        bool step();
+        void run() {
+            while( step() ) {}
+        }
+    };
+
+    // cancellation source. waiters bound to a cancelled token are resumed on next loop step, and
+    // their co_await yields false. cancel_after()/cancel_at() turn a token into a timeout; a pending
+    // timeout alone does not keep loop::run() going.
+    class token {
+        using waiter = detail::waiter;
+        friend struct detail::waiter;
+        friend class loop;
+
+        waiter *head = 0;
+        waiter alarm;
+        bool flag = false;
+
+        void attach( waiter *w );
+        void detach( waiter *w );
+
+        public:
+
+        token() = default;
+        token( const token & ) = delete;
+        token &operator=( const token & ) = delete;
+        ~token();
+
+        void cancel();
+        void cancel_after( int64_t lapse );
+        void cancel_at( int64_t stamp );
+        bool cancelled() const {
+            return flag;
+        }
+    };
+
+    // one-shot awaitable. co_await yields true on expiry, false if cancelled.
+    class sleeper {
+        detail::waiter w;
+
+        public:
+
+        sleeper( int64_t deadline, token *tk ) {
+            w.deadline = deadline;
+            w.owner = tk;
+        }
+        bool await_ready() {
+            return w.ready();
+        }
+        void await_suspend( std::coroutine_handle<> h ) {
+            w.suspend( h );
+        }
+        bool await_resume() const {
+            return !w.cancelled;
+        }
+    };
+
+    // co_await for a relative lapse, or until an absolute utc() stamp
+    sleeper after( int64_t lapse, token *tk = 0 );
+    sleeper at( int64_t stamp, token *tk = 0 );
+
+    // usage:
+    // sand::interval iv( sand::seconds(1) );
+    // while( co_await iv ) {} // ticks keep their phase; missed ticks are skipped rather than bursted
+    class interval {
+        detail::waiter w;
+        int64_t period;
+
+        public:
+
+        explicit
+        interval( int64_t lapse, token *tk = 0 );
+
+        bool await_ready() {
+            return w.ready();
+        }
+        void await_suspend( std::coroutine_handle<> h ) {
+            w.suspend( h );
+        }
+        bool await_resume();
+    };
+
+#endif
 }
 
 